@@ -0,0 +1,339 @@
+// Benchmarks for the naive and Eigen implementations.
+// The two sets of headers define the same class names, so each implementation is its own build of this file:
+//
+//     g++ -O3 -march=native -DNDEBUG -fopenmp -I/usr/include/eigen3 BENCHMARK.cpp -o bench_naive
+//     g++ -O3 -march=native -DNDEBUG -fopenmp -I/usr/include/eigen3 -DBENCH_EIGEN BENCHMARK.cpp -o bench_eigen
+//     ./bench_naive > bench_output.txt && ./bench_eigen >> bench_output.txt
+//
+// -DBENCH_SINGLE benchmarks the single output networks (NEURAL.H / NEURAL_EIGEN.H) instead of the multiple output ones
+// (NEURALMO.H / NEURAL_EIGEN_MO.H); the multiple output Eigen build also benchmarks
+// NEURAL_EIGEN_FIXED.H and TRAINER.H. The optional argument is the time spent on each measurement in seconds (default 0.25).
+//
+// Every row is one workload: samples (or products) per second, GFLOP/s and heap allocations per step.
+// With -fopenmp on a multi-core machine Eigen runs its products in parallel and those allocate, so the Eigen rows only
+// show 0 allocations per step with OMP_NUM_THREADS=1 (or a build without -fopenmp).
+// FLOPs count a multiply-add as 2 and are nominal (a convolution counts as direct even when the FFT path is taken).
+// After the sweeps the per-layer profiler (MODULAR/PROFILE.H) breaks down one dense and one convolutional model.
+
+#include <cstdlib>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <new>
+
+std::atomic<long long> ALLOCS(0);
+
+// Count every heap allocation. On glibc malloc itself is replaced, which also catches Eigen (it calls malloc directly).
+// Elsewhere only operator new is counted.
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    ALLOCS.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    ALLOCS.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    ALLOCS.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+void* operator new(size_t size) {
+    ALLOCS.fetch_add(1, std::memory_order_relaxed);
+    void* res = std::malloc(size > 0 ? size : 1);
+    if (res == nullptr) throw std::bad_alloc();
+    return res;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    std::free(ptr);
+}
+#endif
+
+#ifdef BENCH_EIGEN
+
+#include <Eigen/Dense>
+#ifdef BENCH_SINGLE
+#include "NEURAL_EIGEN.H"
+#else
+#include "NEURAL_EIGEN_MO.H"
+#include "NEURAL_EIGEN_FIXED.H"
+#include "TRAINER.H"
+#endif
+#include "MODULAR/NN_EIGEN.H"
+#include "MODULAR/CNN_EIGEN.H"
+#include "MODULAR/SEQUENTIAL_EIGEN.H"
+
+typedef Eigen::MatrixXd Mat;
+const char* IMPL = "eigen";
+
+int rowsof(const Mat& v) {
+    return v.rows();
+}
+
+int colsof(const Mat& v) {
+    return v.cols();
+}
+
+#else
+
+#ifdef BENCH_SINGLE
+#include "NEURAL.H"
+#else
+#include "NEURALMO.H"
+#endif
+#include "MATRICES.H"
+#include "MODULAR/NN.H"
+#include "MODULAR/CNN.H"
+#include "MODULAR/SEQUENTIAL.H"
+
+typedef std::vector<std::vector<double>> Mat;
+const char* IMPL = "naive";
+
+int rowsof(const Mat& v) {
+    return v.size();
+}
+
+int colsof(const Mat& v) {
+    return v.size() > 0 ? v[0].size() : 0;
+}
+
+#endif
+
+double SECONDS = 0.25;
+
+struct Result {
+    double steps = 0;
+    double seconds = 0;
+    double allocs = 0; // per step
+};
+
+// Runs step once to warm up (this is where buffers get planned), then as often as fits in SECONDS.
+template <class F>
+Result measure(F step) {
+    step();
+    Result res;
+    long long allocs = ALLOCS.load();
+    auto begin = std::chrono::steady_clock::now();
+    do {
+        step();
+        res.steps++;
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    } while (res.seconds < SECONDS);
+    res.allocs = (ALLOCS.load() - allocs) / res.steps;
+    return res;
+}
+
+// samples is the number of samples per step and flops the FLOPs per step.
+void report(const char* section, std::string config, Result r, double samples, double flops) {
+    printf("%-6s %-8s %-36s %14.0f %10.3f %12.1f\n", IMPL, section, config.c_str(), r.steps * samples / r.seconds, r.steps * flops / r.seconds * 1e-9, r.allocs);
+}
+
+// NEURAL*.H
+
+double target(double) {
+    return 0.5;
+}
+
+std::vector<double> target(const std::vector<double>& y) {
+    return std::vector<double>(y.size(), 0.5);
+}
+
+void networks() {
+    int shapes[][4] = {{2, 1, 2, 2}, {8, 1, 16, 2}, {32, 2, 64, 4}, {128, 2, 256, 8}, {256, 4, 512, 16}};
+    for (auto& s : shapes) {
+#ifdef BENCH_SINGLE
+        NeuralNetwork nn(s[0], s[1], s[2]);
+        std::string config = "in " + std::to_string(s[0]) + " layers " + std::to_string(s[1]) + " hidden " + std::to_string(s[2]);
+#else
+        NeuralNetwork nn(s[0], s[1], s[2], s[3]);
+        std::string config = "in " + std::to_string(s[0]) + " layers " + std::to_string(s[1]) + " hidden " + std::to_string(s[2]) + " out " + std::to_string(s[3]);
+#endif
+        std::vector<double> w(nn.weightcount());
+        for (auto& i : w) i = 0.1 * (1 - 2 * (double)(rand()) / RAND_MAX);
+        nn.importweights(w.data());
+
+        std::vector<double> x(s[0], 0.3);
+        auto desired = target(nn.eval(x));
+
+        report("eval", config, measure([&] { nn.eval(x); }), 1, 2.0 * w.size());
+        report("train", config, measure([&] { nn.backprop(nn.eval(x), desired, 0.001); }), 1, 6.0 * w.size());
+    }
+}
+
+#if defined(BENCH_EIGEN) && !defined(BENCH_SINGLE)
+// TRAINER.H: the same shapes trained in mini-batches of 256, on 1 thread and on every hardware thread
+
+void trainer() {
+    int shapes[][4] = {{32, 2, 64, 4}, {128, 2, 256, 8}, {256, 4, 512, 16}};
+    for (auto& s : shapes) {
+        NeuralNetwork nn(s[0], s[1], s[2], s[3]);
+        std::vector<double> w(nn.weightcount());
+        for (auto& i : w) i = 0.1 * (1 - 2 * (double)(rand()) / RAND_MAX);
+        nn.importweights(w.data());
+
+        Training::Batch<double> batch;
+        batch.size = 256;
+        batch.x = std::vector<double>(batch.size * s[0], 0.3);
+        batch.y = std::vector<double>(batch.size * s[3], 0.5);
+        std::string config = "in " + std::to_string(s[0]) + " layers " + std::to_string(s[1]) + " hidden " + std::to_string(s[2]) + " out " + std::to_string(s[3]);
+
+        std::vector<int> counts = {1};
+        if (std::thread::hardware_concurrency() > 1) counts.push_back(std::thread::hardware_concurrency());
+        for (int threads : counts) {
+            for (auto mode : {Training::Trainer<NeuralNetwork>::SYNC, Training::Trainer<NeuralNetwork>::HOGWILD}) {
+                Training::Trainer<NeuralNetwork> t(nn, threads, mode);
+                std::string name = std::string(mode == Training::Trainer<NeuralNetwork>::SYNC ? "sync" : "hogwild") + " x" + std::to_string(threads) + " ";
+                report("trainer", name + config, measure([&] { t.train(batch, 0.0001); }), batch.size, 6.0 * w.size() * batch.size);
+            }
+        }
+    }
+}
+#endif
+
+#if defined(BENCH_EIGEN) && !defined(BENCH_SINGLE)
+// NEURAL_EIGEN_FIXED.H: the small shapes with the topology fixed at compile time
+
+template <class Net>
+void fixed(std::string config) {
+    Net nn = Genetic::randomAI<Net>(0.1);
+    typename Net::Input x = Net::Input::Constant(0.3);
+    typename Net::Output desired = Net::Output::Constant(0.5);
+    typename Net::Output y;
+    report("fixed", config, measure([&] { y = nn.eval(x); }), 1, 2.0 * nn.weightcount());
+    report("fixed", config + " train", measure([&] { nn.backprop(nn.eval(x), desired, 0.001); }), 1, 6.0 * nn.weightcount());
+}
+
+void fixednetworks() {
+    fixed<FixedNetwork<2, 1, 2, 2>>("in 2 layers 1 hidden 2 out 2");
+    fixed<FixedNetwork<8, 1, 16, 2>>("in 8 layers 1 hidden 16 out 2");
+    fixed<FixedNetwork<32, 2, 64, 4>>("in 32 layers 2 hidden 64 out 4");
+}
+#endif
+
+// MODULAR Sequential models
+
+// FLOPs of one train step, as reported by the layers for the planned shapes.
+double stepflops(Sequential& model) {
+    double res = 0;
+    for (int i = 0; i < model.size(); i++) {
+        int rows = rowsof(model.values[i]);
+        int cols = colsof(model.values[i]);
+        res += model[i].flops(rows, cols) + model[i].backflops(rows, cols);
+    }
+    return res;
+}
+
+void dense(Sequential& model, int width, int batch) {
+    model.add(BasicLayer(Layer::random(width + 1, width, 0.1)));
+    model.add(SigmoidLayer(width, batch));
+    model.add(BasicLayer(Layer::random(width + 1, width, 0.1)));
+    model.add(SigmoidLayer(width, batch));
+    model.add(BasicLayer(Layer::random(width + 1, 10, 0.1)));
+}
+
+void conv(Sequential& model, int k, int size, int channels, int kernels, int stride, int batch) {
+    ConvLayer& c = model.add(ConvLayer(k, k, size, size, channels, kernels, stride, k / 2));
+    c.kernel = Layer::random(kernels * channels * k, k, 0.1);
+    model.add(ReLULayer(batch * kernels * c.out_n, c.out_m));
+}
+
+void sequential() {
+    for (int width : {64, 256, 1024}) {
+        for (int batch : {1, 32, 256}) {
+            Sequential model;
+            dense(model, width, batch);
+            Mat x = Layer::random(width, batch, 1);
+            Mat y = Layer::random(10, batch, 1);
+            std::string config = "width " + std::to_string(width) + " batch " + std::to_string(batch);
+            model.train(x, y, 0.001);
+            report("dense", config, measure([&] { model.train(x, y, 0.001); }), batch, stepflops(model));
+        }
+    }
+
+    // 4 -> 8 channels on 32x32 images, batches of 8. By default kernels of 7x7 (naive) or 9x9 (Eigen) and up take the
+    // FFT path, build with -DCONV_FFT_THRESHOLD=1000000 to compare against im2col.
+    int configs[][2] = {{3, 1}, {5, 1}, {7, 1}, {9, 1}, {11, 1}, {15, 1}, {3, 2}, {5, 2}};
+    for (auto& k : configs) {
+        Sequential model;
+        conv(model, k[0], 32, 4, 8, k[1], 8);
+        Mat x = Layer::random(8 * 4 * 32, 32, 1);
+        const Mat& out = model.compute(x);
+        Mat y = Layer::random(rowsof(out), colsof(out), 1);
+        std::string config = "kernel " + std::to_string(k[0]) + " stride " + std::to_string(k[1]) + " 32x32 4->8 batch 8";
+        report("conv", config, measure([&] { model.train(x, y, 0.001); }), 8, stepflops(model));
+    }
+}
+
+// MATRICES.H, against Eigen's own product in the Eigen build
+
+void matrices() {
+    for (int n : {64, 128, 256, 512, 1024}) {
+        std::string config = std::to_string(n) + "x" + std::to_string(n);
+#ifdef BENCH_EIGEN
+        Eigen::MatrixXd a = Eigen::MatrixXd::Random(n, n);
+        Eigen::MatrixXd b = Eigen::MatrixXd::Random(n, n);
+        Eigen::MatrixXd c(n, n);
+        report("matmul", config, measure([&] { c.noalias() = a * b; }), 1, 2.0 * n * n * n);
+#else
+        Matrix a = Matrix::random(n, n);
+        Matrix b = Matrix::random(n, n);
+        report("matmul", config, measure([&] { Matrix c = a * b; }), 1, 2.0 * n * n * n);
+#endif
+    }
+}
+
+void profiles() {
+    Profiler prof;
+
+    Sequential model;
+    dense(model, 256, 32);
+    model.profiler = &prof;
+    Mat x = Layer::random(256, 32, 1);
+    Mat y = Layer::random(10, 32, 1);
+    measure([&] { model.train(x, y, 0.001); });
+    printf("\n%s PROFILE dense width 256 batch 32\n%s", IMPL, prof.toString().c_str());
+
+    prof.reset();
+    Sequential cnn;
+    conv(cnn, 5, 32, 4, 8, 1, 8);
+    cnn.add(SigmoidLayer());
+    cnn.profiler = &prof;
+    Mat cx = Layer::random(8 * 4 * 32, 32, 1);
+    const Mat& out = cnn.compute(cx);
+    Mat cy = Layer::random(rowsof(out), colsof(out), 1);
+    measure([&] { cnn.train(cx, cy, 0.001); });
+    printf("\n%s PROFILE conv 5x5 32x32 4->8 batch 8\n%s", IMPL, prof.toString().c_str());
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) SECONDS = atof(argv[1]);
+    srand(1);
+
+    printf("%-6s %-8s %-36s %14s %10s %12s\n", "IMPL", "BENCH", "CONFIG", "SAMPLES/S", "GFLOP/S", "ALLOCS/STEP");
+    networks();
+#if defined(BENCH_EIGEN) && !defined(BENCH_SINGLE)
+    fixednetworks();
+    trainer();
+#endif
+    sequential();
+    matrices();
+    profiles();
+    return 0;
+}